@@ -0,0 +1,53 @@
+// Sample loadable builtin: basename <path> [suffix]
+//
+// Built twice by the Makefile:
+//   basename.so  loaded in-process with `enable -f loadables/basename.so basename`
+//   basename     the same code as a standalone executable (for comparison)
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../wsh_builtin.h"
+
+int basename_main(const wsh_builtin_ctx *ctx) {
+    if (ctx->argc < 2 || ctx->argc > 3) {
+        dprintf(ctx->err_fd, "usage: basename <path> [suffix]\n");
+        return 1;
+    }
+
+    // strip trailing slashes, then everything up to the last one
+    char *path = ctx->argv[1];
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') end--;
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') start--;
+    if (end == 1 && path[0] == '/') start = 0;
+
+    // drop suffix unless it is the whole name
+    if (ctx->argc == 3) {
+        size_t slen = strlen(ctx->argv[2]);
+        if (slen < end - start && strncmp(path + end - slen, ctx->argv[2], slen) == 0)
+            end -= slen;
+    }
+
+    dprintf(ctx->out_fd, "%.*s\n", (int)(end - start), path + start);
+    return 0;
+}
+
+wsh_builtin basename_builtin = { WSH_BUILTIN_ABI, "basename", basename_main };
+
+#ifdef WSH_STANDALONE
+extern char **environ;
+
+int main(int argc, char *argv[]) {
+    wsh_builtin_ctx ctx = {
+        .argc = argc,
+        .argv = argv,
+        .in_fd = STDIN_FILENO,
+        .out_fd = STDOUT_FILENO,
+        .err_fd = STDERR_FILENO,
+        .envp = environ,
+    };
+    return basename_main(&ctx);
+}
+#endif
@@ -0,0 +1,19 @@
+#! /usr/bin/env bash
+# Compare a loadable builtin against the same code run as an external binary.
+# Usage: ./loadables/bench.sh [iterations]   (from solution/, after `make loadables`)
+
+N=${1:-2000}
+DIR=$(cd "$(dirname "$0")" && pwd)
+WSH=$DIR/../wsh
+EXT=$(mktemp)
+BLT=$(mktemp)
+trap 'rm -f $EXT $BLT' EXIT
+
+for ((i = 0; i < N; i++)); do echo "$DIR/basename /usr/lib/libfoo.so .so"; done > $EXT
+echo "enable -f $DIR/basename.so basename" > $BLT
+for ((i = 0; i < N; i++)); do echo "basename /usr/lib/libfoo.so .so"; done >> $BLT
+
+echo "external ($N calls):"
+time $WSH $EXT > /dev/null
+echo "loadable ($N calls):"
+time $WSH $BLT > /dev/null
@@ -10,15 +10,173 @@
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <sys/inotify.h>
 #include "wsh.h"
+#include "wsh_builtin.h"
 
 #define MIN_INPUT_SIZE 16
 #define MIN_TOKEN_LIST_SIZE 5
-#define TOTAL_BUILTINS 6
+#define TOTAL_BUILTINS 11
 #define TOTAL_REDIRECTIONS 5
 #define PATH "PATH"
 #define DEFAULT_PATH "/bin"
 #define DEFAULT_HISTORY_SIZE 5
+#define CACHE_DIR_ENV "WSH_CACHE_DIR"
+#define CACHE_ENV_ENV "WSH_CACHE_ENV"
+#define CACHE_SIZE_ENV "WSH_CACHE_SIZE"
+#define DEFAULT_CACHE_DIR ".wsh_cache"
+#define DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+#define CACHE_MAGIC "WSHC1"
+#define TIMEOUT_ENV "WSH_TIMEOUT"
+#define TIMEOUT_RC 124
+#define DEFAULT_KILL_GRACE 2.0
+#define WAIT_POLL_MS 10
+#define MAX_TIMEOUT_SECS ((double)INT32_MAX)
+#define WATCH_FLAG "--watch"
+#define WATCH_DEBOUNCE_MS 100
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ATTRIB)
+
+// --------MEMORY ACCOUNTING---------
+//
+// Built with -DWSH_MEMSTATS (make MEMSTATS=1), every allocation made by
+// the shell carries a header with its size and the subsystem that was
+// active (MEM_TAG) when it was made. Otherwise the macros below compile
+// away and allocations go straight to libc.
+enum mem_tag { MEM_HISTORY, MEM_LOCALS, MEM_PARSE, MEM_OTHER, TOTAL_MEM_TAGS };
+
+#ifdef WSH_MEMSTATS
+static char *mem_tags[TOTAL_MEM_TAGS] = {
+    "history",
+    "locals",
+    "parse",
+    "other",
+};
+
+// 16 bytes, so user pointers keep malloc's alignment
+typedef struct mem_hdr {
+    size_t size;
+    size_t tag;
+} mem_hdr;
+
+typedef struct mem_stat {
+    size_t live;
+    size_t nlive;
+    size_t nallocs;
+    size_t peak;
+} mem_stat;
+mem_stat mem_stats[TOTAL_MEM_TAGS];
+size_t mem_live = 0;
+size_t mem_peak = 0;
+int mem_tag = MEM_OTHER;
+
+void mem_grow(size_t tag, size_t size) {
+    mem_stats[tag].live += size;
+    mem_live += size;
+    if (mem_stats[tag].live > mem_stats[tag].peak) mem_stats[tag].peak = mem_stats[tag].live;
+    if (mem_live > mem_peak) mem_peak = mem_live;
+}
+
+void mem_shrink(size_t tag, size_t size) {
+    mem_stats[tag].live -= size;
+    mem_live -= size;
+}
+
+void *mem_malloc(size_t size) {
+    mem_hdr *h = malloc(sizeof(mem_hdr) + size);
+    if (h == NULL) return NULL;
+    h->size = size;
+    h->tag = mem_tag;
+    mem_stats[h->tag].nallocs++;
+    mem_stats[h->tag].nlive++;
+    mem_grow(h->tag, size);
+    return h + 1;
+}
+
+void *mem_calloc(size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) { errno = ENOMEM; return NULL; }
+    void *ptr = mem_malloc(nmemb * size);
+    if (ptr != NULL) memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) return mem_malloc(size);
+    mem_hdr *h = (mem_hdr*)ptr - 1;
+    size_t old = h->size;
+    mem_hdr *nh = realloc(h, sizeof(mem_hdr) + size);
+    if (nh == NULL) return NULL;
+    nh->size = size;
+    mem_shrink(nh->tag, old);
+    mem_grow(nh->tag, size);
+    return nh + 1;
+}
+
+void *mem_reallocarray(void *ptr, size_t nmemb, size_t size) {
+    if (size != 0 && nmemb > SIZE_MAX / size) { errno = ENOMEM; return NULL; }
+    return mem_realloc(ptr, nmemb * size);
+}
+
+char *mem_strndup(const char *s, size_t n) {
+    size_t len = strnlen(s, n);
+    char *dup = mem_malloc(len + 1);
+    if (dup == NULL) return NULL;
+    memcpy(dup, s, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+char *mem_strdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *dup = mem_malloc(len);
+    if (dup != NULL) memcpy(dup, s, len);
+    return dup;
+}
+
+void mem_free(void *ptr) {
+    if (ptr == NULL) return;
+    mem_hdr *h = (mem_hdr*)ptr - 1;
+    mem_stats[h->tag].nlive--;
+    mem_shrink(h->tag, h->size);
+    free(h);
+}
+
+int mem_enter(int tag) {
+    int prev = mem_tag;
+    mem_tag = tag;
+    return prev;
+}
+
+void mem_leave(int *prev) {
+    mem_tag = *prev;
+}
+
+// tag allocations made until the end of the enclosing block
+#define MEM_TAG(tag) int mem_prev_ __attribute__((cleanup(mem_leave))) = mem_enter(tag)
+
+#undef strdup
+#undef strndup
+#define malloc(size) mem_malloc(size)
+#define calloc(nmemb, size) mem_calloc(nmemb, size)
+#define realloc(ptr, size) mem_realloc(ptr, size)
+#define reallocarray(ptr, nmemb, size) mem_reallocarray(ptr, nmemb, size)
+#define strdup(s) mem_strdup(s)
+#define strndup(s, n) mem_strndup(s, n)
+#define free(ptr) mem_free(ptr)
+
+// memory allocated inside libc (getline, scandir) bypasses accounting
+#define libc_free(ptr) (free)(ptr)
+#else
+#define MEM_TAG(tag) (void)(tag)
+#define libc_free(ptr) free(ptr)
+#endif
 
 // shell built-ins
 // (EXIT is handled separately to manage memory)
@@ -28,7 +186,12 @@ static char *builtins[TOTAL_BUILTINS] = {
     LOCAL,
     VARS,
     HISTORY,
-    LS
+    LS,
+    PARALLEL,
+    ENABLE,
+    CACHE,
+    TIMEOUT,
+    MEMSTATS
 };
 static int (*builtin_fn[TOTAL_BUILTINS])(size_t, char**) = {
     &wsh_cd,
@@ -37,6 +200,11 @@ static int (*builtin_fn[TOTAL_BUILTINS])(size_t, char**) = {
     &wsh_vars,
     &wsh_history,
     &wsh_ls,
+    &wsh_parallel,
+    &wsh_enable,
+    &wsh_cache,
+    &wsh_timeout,
+    &wsh_memstats,
 };
 
 static char *redirects[TOTAL_REDIRECTIONS] = {
@@ -73,6 +241,7 @@ size_t histsize = DEFAULT_HISTORY_SIZE;
 size_t histentries = 0;
 
 void free_history(hentry *i) {
+    MEM_TAG(MEM_HISTORY);
     hentry *tmp = NULL;
     while (i != NULL) {
         freev((void*)i->argv, (i->argc), 1);
@@ -83,6 +252,7 @@ void free_history(hentry *i) {
 }
 
 void log_in_history(size_t argc, char **argv) {
+    MEM_TAG(MEM_HISTORY);
     if (hhead == NULL) {
         hentry *newentry = malloc(sizeof(hentry));
         newentry->argc = argc;
@@ -160,6 +330,7 @@ typedef struct localvar {
 localvar *lhead = NULL;
 
 void free_locals() {
+    MEM_TAG(MEM_LOCALS);
     localvar *i = lhead;
     while (i != NULL) {
         free(i->name);
@@ -171,120 +342,330 @@ void free_locals() {
 }
 
 
+// builtins loaded from shared objects
+typedef struct loadable {
+    char *name;
+    char *path;
+    void *handle;
+    int (*fn)(const wsh_builtin_ctx *ctx);
+    struct loadable *next;
+} loadable;
+loadable *bhead = NULL;
+
+void free_loadable(loadable *i) {
+    dlclose(i->handle);
+    free(i->name);
+    free(i->path);
+    free(i);
+}
+
+void free_loadables() {
+    loadable *i = bhead;
+    while (i != NULL) {
+        loadable *tmp = i->next;
+        free_loadable(i);
+        i = tmp;
+    }
+    bhead = NULL;
+}
+
+loadable *find_loadable(char *name) {
+    loadable *i = bhead;
+    while (i != NULL) {
+        if (strcmp(name, i->name) == 0) return i;
+        i = i->next;
+    }
+    return NULL;
+}
+
+// check if cmd runs inside the shell process
+int is_builtin(char *cmd) {
+    if (strcmp(cmd, EXIT) == 0) return 1;
+    for (size_t i = 0; i < TOTAL_BUILTINS; i++)
+        if (strcmp(cmd, builtins[i]) == 0) return 1;
+    return find_loadable(cmd) != NULL;
+}
+
+// call a loaded builtin on the shell's (already redirected) stdio
+// returns fn's status as is, like an external command's exit code
+int exec_loadable(loadable *b, size_t argc, char **argv) {
+    wsh_builtin_ctx ctx = {
+        .argc = (int)argc,
+        .argv = argv,
+        .in_fd = STDIN_FILENO,
+        .out_fd = STDOUT_FILENO,
+        .err_fd = STDERR_FILENO,
+        .envp = environ,
+    };
+    fflush(stdout);
+    fflush(stderr);
+    int rc = b->fn(&ctx);
+    fflush(stdout);
+    fflush(stderr);
+    return rc;
+}
+
 // shell return code
 int shell_rc = 0;
 
 // fetch variable value, if exists
-char *fetch_if_var(char *token) {
-    char pre[2] = "$";
-    if (strncmp(pre, token, strlen(pre)) == 0) {
-        char *tok_dup = strdup(token);
-        char *tok = strtok(tok_dup, pre);
-
-        // 1. check env
-        char *val;
-        if ((val = getenv(tok)) != NULL) {
-            // TO-DO: extra free byte bug?
-            free(tok_dup);
-            return val;
-        }
-
-        // 2. check local
-        localvar *i = lhead;
-        while (i != NULL) {
-            if (strcmp(tok, i->name) == 0) {
-                free(tok_dup);
-                return i->value;
-            }
-            i = i->next;
+// (name need not be null-terminated; env takes precedence over locals)
+char *fetch_var(const char *name, size_t len) {
+    // 1. check env
+    for (char **env = environ; *env != NULL; env++) {
+        if (strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+    }
+
+    // 2. check local
+    localvar *i = lhead;
+    while (i != NULL) {
+        if (strncmp(i->name, name, len) == 0 && i->name[len] == '\0')
+            return i->value;
+        i = i->next;
+    }
+    return NULL;
+}
+
+// expand $VAR and ${VAR} references anywhere in token
+// writes the result to out (if not NULL) and returns its length,
+// or -1 on an unterminated ${
+ssize_t expand_token(const char *token, char *out) {
+    size_t len = 0;
+    const char *ptr = token;
+    while (*ptr != '\0') {
+        const char *name = ptr + 1;
+        size_t namelen = 0;
+        if (*ptr == '$' && *name == '{') {
+            const char *end = strchr(++name, '}');
+            if (end == NULL) return -1;
+            namelen = end - name;
+            ptr = end + 1;
+        }
+        else if (*ptr == '$' && (isalnum((unsigned char)*name) || *name == '_')) {
+            while (isalnum((unsigned char)name[namelen]) || name[namelen] == '_') namelen++;
+            ptr = name + namelen;
+        }
+        else {
+            // plain characters, including a lone '$'
+            if (out) out[len] = *ptr;
+            len++;
+            ptr++;
+            continue;
         }
-        free(tok_dup);
+
+        // unset variables expand to an empty string
+        char *val = fetch_var(name, namelen);
+        size_t vlen = val ? strlen(val) : 0;
+        if (out && vlen) memcpy(out + len, val, vlen);
+        len += vlen;
     }
+    if (out) out[len] = '\0';
+    return len;
+}
+
+// resolve cmd to an executable path (full-path or $PATH lookup)
+char *resolve_cmd(char *cmd) {
+    // 1. check if cmd is a full-path to executable
+    if (access(cmd, X_OK) == 0) return strdup(cmd);
+
+    // 2. check if cmd path can be found in $PATH
+    char *path = getenv(PATH);
+    if (path == NULL) return NULL;
+
+    char *path_dup = strdup(path);
+    char delim[2] = ":";
+    char *token = strtok(path_dup, delim);
+    while (token != NULL) {
+        size_t pathlen = 0;
+        pathlen = strlen(token) + strlen("/") + strlen(cmd) + 1;
+        char *fullpath = malloc(pathlen);
+        snprintf(fullpath, pathlen, "%s/%s", token, cmd);
+
+        if (access(fullpath, X_OK) == 0) {
+            free(path_dup);
+            return fullpath;
+        }
+        free(fullpath);
+        token = strtok(NULL, delim);
+    }
+    free(path_dup);
     return NULL;
 }
 
-int exec_in_new_proc(char *cmd, char **args) {
-    pid_t child_pid, wpid;
-    int status;
-    child_pid = fork();
-    if (child_pid == -1) return -1;
-    else if (child_pid == 0) {
-        if(execv(cmd, args) == -1) return -1;
+// fork and exec cmd without waiting for it
+// (out_fd/err_fd of -1 leave the child's stdout/stderr untouched)
+pid_t launch_proc(char *cmd, char **args, int out_fd, int err_fd) {
+    pid_t child_pid = fork();
+    if (child_pid == 0) {
+        if (out_fd != -1) dup2(out_fd, STDOUT_FILENO);
+        if (err_fd != -1) dup2(err_fd, STDERR_FILENO);
+        execv(cmd, args);
+        _exit(EXIT_FAILURE);
     }
-    else {
-        do {
-            wpid = waitpid(child_pid, &status, WUNTRACED);
-            if (wpid == -1) return -1;
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+    return child_pid;
+}
+
+// write all of buf to fd, retrying short writes
+int write_all(int fd, const char *buf, size_t n) {
+    size_t off = 0;
+    while (off < n) {
+        ssize_t w = write(fd, buf + off, n - off);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        off += w;
     }
     return 0;
 }
 
-char **parse_cmd(size_t argc, char **argv) {
-    char *var_v = NULL;
-    char **argv_parsed = calloc(argc + 1, sizeof(char*));
-    size_t i = 0;
-    for (i = 0; i < argc; i++) {
-        // check for whole variables strings
-        if ((var_v = fetch_if_var(argv[i])) != NULL) {
-            argv_parsed[i] = malloc(strlen(var_v) + 1);
-            strcpy(argv_parsed[i], var_v);
-            continue;
-        }
+// parse a (possibly fractional) number of seconds, -1 if invalid
+// (inf/nan included); clamped to MAX_TIMEOUT_SECS so it fits a time_t
+double parse_secs(const char *str) {
+    if (str == NULL || *str == '\0') return -1;
+    errno = 0;
+    char *endptr;
+    double secs = strtod(str, &endptr);
+    if (errno == ERANGE || *endptr != '\0' || !isfinite(secs) || secs < 0) return -1;
+    return secs > MAX_TIMEOUT_SECS ? MAX_TIMEOUT_SECS : secs;
+}
 
-        // check for variables in key/value pairs
-        char *ptr = NULL;
-        if ((ptr = strchr(argv[i], '=')) != NULL) {
-            char delim[2] = "=";
-            size_t cnt = 0;
-            const size_t nvars = 2;
-            size_t ttok_len = 0;
-            char *arg_dup = strdup(argv[i]);
-            char *token = strtok(arg_dup, delim);
-            char **tokens = calloc(nvars, sizeof(char*));
-            while (token != NULL) {
-                // ignore any extra tokens
-                if (cnt > nvars-1) break;
-
-                ptr = NULL;
-                var_v = NULL;
-                if ((ptr = strchr(token, '$')) != NULL) {
-                    if (cnt == 0) {
-                        free(arg_dup);
-                        freev((void*)argv_parsed, argc, 1);
-                        freev((void*)tokens, nvars, 1);
-                        return NULL;
-                    }
+// milliseconds left until deadline (CLOCK_MONOTONIC)
+int ms_until(struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ms = (deadline->tv_sec - now.tv_sec) * 1000LL
+                 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms < 0 ? 0 : (ms > INT32_MAX ? INT32_MAX : (int)ms);
+}
 
-                    if ((var_v = fetch_if_var(token)) != NULL) {
-                        tokens[cnt] = malloc(strlen(var_v) + 1);
-                        strcpy(tokens[cnt], var_v);
-                        ttok_len += strlen(var_v);
-                    }
-                }
-                if (var_v == NULL) {
-                    tokens[cnt] = malloc(strlen(token) + 1);
-                    strcpy(tokens[cnt], token);
-                    ttok_len += strlen(token);
-                }
+// set ts to secs from now (CLOCK_MONOTONIC)
+void deadline_in(struct timespec *ts, double secs) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += (time_t)secs;
+    ts->tv_nsec += (long)((secs - (time_t)secs) * 1e9);
+    if (ts->tv_nsec >= 1000000000L) { ts->tv_sec++; ts->tv_nsec -= 1000000000L; }
+}
 
-                cnt++;
-                token = strtok(NULL, delim);
-            }
-            free(arg_dup);
+// pidfd for child_pid, or -1 if the kernel doesn't support them
+int proc_pidfd(pid_t child_pid) {
+    return (int)syscall(SYS_pidfd_open, child_pid, 0);
+}
 
+// signal an unreaped child through its pidfd if it has one
+void signal_proc(pid_t child_pid, int pidfd, int sig) {
+    if (pidfd != -1) syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+    else kill(child_pid, sig);
+}
 
-            // 2 extra bytes -> "=" and null byte
-            argv_parsed[i] = malloc(ttok_len + 2);
-            snprintf(argv_parsed[i], ttok_len + 2, "%s=%s", tokens[0], tokens[1]);
-            freev((void*)tokens, nvars, 1);
-            continue;
+// shell status for a wait status: exit code, or 128 + signal
+int exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+// wait until child_pid exits or deadline passes; 1 if it exited
+// polls the pidfd, or without one polls waitpid(WNOHANG) every
+// WAIT_POLL_MS (then *reaped is set once its status is collected)
+int wait_exit(pid_t child_pid, int pidfd, struct timespec *deadline, int *status, int *reaped) {
+    if (pidfd != -1) {
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+        for (;;) {
+            int rc = poll(&pfd, 1, ms_until(deadline));
+            if (rc > 0) return 1;
+            if (rc == 0) return 0;
+            if (errno != EINTR) return -1;
         }
+    }
+
+    for (;;) {
+        pid_t wpid = waitpid(child_pid, status, WNOHANG);
+        if (wpid == child_pid) { *reaped = 1; return 1; }
+        if (wpid == -1 && errno != EINTR) return -1;
+
+        int ms = ms_until(deadline);
+        if (ms == 0) return 0;
+        if (ms > WAIT_POLL_MS) ms = WAIT_POLL_MS;
+        struct timespec nap = { .tv_sec = 0, .tv_nsec = ms * 1000000L };
+        nanosleep(&nap, NULL);
+    }
+}
+
+// wait for child_pid; with a deadline it gets SIGTERM once it passes,
+// then SIGKILL after grace more seconds (*killed is set)
+// returns its exit code, TIMEOUT_RC if it was killed, or -1
+int wait_proc_until(pid_t child_pid, struct timespec *deadline, double grace, int *killed) {
+    int status = 0;
+    int reaped = 0;
+    *killed = 0;
+    if (deadline != NULL) {
+        int pidfd = proc_pidfd(child_pid);
+        if (wait_exit(child_pid, pidfd, deadline, &status, &reaped) == 0) {
+            struct timespec kill_at;
+            *killed = 1;
+            signal_proc(child_pid, pidfd, SIGTERM);
+            deadline_in(&kill_at, grace);
+            if (wait_exit(child_pid, pidfd, &kill_at, &status, &reaped) == 0)
+                signal_proc(child_pid, pidfd, SIGKILL);
+        }
+        if (pidfd != -1) close(pidfd);
+    }
 
-        argv_parsed[i] = malloc(strlen(argv[i]) + 1);
-        strcpy(argv_parsed[i], argv[i]);
+    // the child has exited (or has no deadline), so this only reaps it
+    while (!reaped) {
+        pid_t wpid = waitpid(child_pid, &status, WUNTRACED);
+        if (wpid == -1 && errno != EINTR) return -1;
+        if (wpid != -1 && (WIFEXITED(status) || WIFSIGNALED(status))) reaped = 1;
     }
-    argv_parsed[i] = NULL;
+    return *killed ? TIMEOUT_RC : exit_code(status);
+}
+
+// wait_proc_until with a deadline timeout seconds from now (<= 0: none)
+int wait_proc(pid_t child_pid, double timeout, double grace, int *killed) {
+    struct timespec deadline;
+    if (timeout > 0) deadline_in(&deadline, timeout);
+    return wait_proc_until(child_pid, timeout > 0 ? &deadline : NULL, grace, killed);
+}
+
+// script-wide deadline for each command ($WSH_TIMEOUT), 0 if unset
+double default_timeout() {
+    double secs = parse_secs(getenv(TIMEOUT_ENV));
+    return secs < 0 ? 0 : secs;
+}
+
+int exec_in_new_proc(char *cmd, char **args) {
+    pid_t child_pid;
+    int killed;
+    if ((child_pid = launch_proc(cmd, args, -1, -1)) == -1) return -1;
+    return wait_proc(child_pid, default_timeout(), DEFAULT_KILL_GRACE, &killed);
+}
+
+// expand variables in all tokens
+// returns a NULL-terminated argv packed into a single allocation (free once)
+char **parse_cmd(size_t argc, char **argv) {
+    MEM_TAG(MEM_PARSE);
+    // 1. size the expanded tokens
+    size_t total = (argc + 1) * sizeof(char*);
+    for (size_t i = 0; i < argc; i++) {
+        // variable names in key/value pairs can't be substituted
+        char *eq = strchr(argv[i], '=');
+        if (eq != NULL && memchr(argv[i], '$', eq - argv[i]) != NULL) return NULL;
+
+        ssize_t len = expand_token(argv[i], NULL);
+        if (len == -1) return NULL;
+        total += len + 1;
+    }
+
+    // 2. expand into the string area following the pointer array
+    char **argv_parsed = malloc(total);
+    char *buf = (char*)(argv_parsed + argc + 1);
+    for (size_t i = 0; i < argc; i++) {
+        argv_parsed[i] = buf;
+        buf += expand_token(argv[i], buf) + 1;
+    }
+    argv_parsed[argc] = NULL;
     return argv_parsed;
 }
 
@@ -298,34 +679,15 @@ int exec_cmd(size_t argc, char **argv) {
             return rc;
         }
     }
-
-    // 2. check if cmd is a full-path to executable
-    if (access(argv[0], X_OK) == 0) {
-        return exec_in_new_proc(argv[0], argv);
-    }
-
-    // 3. check if cmd path can be found in $PATH
-    char *path = getenv(PATH);
-    if (path != NULL) {
-        char *path_dup = strdup(path);
-        char delim[2] = ":";
-        char *token = strtok(path_dup, delim);
-        while (token != NULL) {
-            size_t pathlen = 0;
-            pathlen = strlen(token) + strlen("/") + strlen(argv[0]) + 1;
-            char *fullpath = malloc(pathlen);
-            snprintf(fullpath, pathlen, "%s/%s", token, argv[0]);
-
-            if (access(fullpath, X_OK) == 0) {
-                int rc =  exec_in_new_proc(fullpath, argv);
-                free(path_dup);
-                free(fullpath);
-                return rc;
-            }
-            free(fullpath);
-            token = strtok(NULL, delim);
-        }
-        free(path_dup);
+    loadable *b = find_loadable(argv[0]);
+    if (b != NULL) return exec_loadable(b, argc, argv);
+
+    // 2. check if cmd is a full-path or can be found in $PATH
+    char *fullpath = resolve_cmd(argv[0]);
+    if (fullpath != NULL) {
+        int rc = exec_in_new_proc(fullpath, argv);
+        free(fullpath);
+        return rc;
     }
 
     return -1;
@@ -341,6 +703,495 @@ int prompt(FILE *stream) {
     return rc;
 }
 
+// print allocation accounting (if compiled in), env size and open fds
+void mem_report(FILE *out) {
+#ifdef WSH_MEMSTATS
+    fprintf(out, "%-8s %10s %8s %8s %10s\n", "subsys", "live", "nlive", "allocs", "peak");
+    size_t nlive = 0, nallocs = 0;
+    for (size_t t = 0; t < TOTAL_MEM_TAGS; t++) {
+        mem_stat *st = &mem_stats[t];
+        fprintf(out, "%-8s %10zu %8zu %8zu %10zu\n", mem_tags[t], st->live, st->nlive, st->nallocs, st->peak);
+        nlive += st->nlive;
+        nallocs += st->nallocs;
+    }
+    fprintf(out, "%-8s %10zu %8zu %8zu %10zu\n", "total", mem_live, nlive, nallocs, mem_peak);
+#else
+    fprintf(out, "allocations: not tracked (rebuild with make MEMSTATS=1)\n");
+#endif
+
+    // environment (owned by libc, so counted rather than tracked)
+    size_t nenv = 0, envbytes = 0;
+    for (char **env = environ; *env != NULL; env++) {
+        nenv++;
+        envbytes += strlen(*env) + 1;
+    }
+    fprintf(out, "env: %zu vars, %zu bytes\n", nenv, envbytes);
+
+    // open fds, excluding the one used to list them
+    DIR *d = opendir("/proc/self/fd");
+    if (d == NULL) return;
+    size_t nfds = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) if (isdigit(de->d_name[0]) && atoi(de->d_name) != dirfd(d)) nfds++;
+    fprintf(out, "fds: %zu\n", nfds);
+    rewinddir(d);
+    while ((de = readdir(d)) != NULL) {
+        if (!isdigit(de->d_name[0]) || atoi(de->d_name) == dirfd(d)) continue;
+        char link[PATH_MAX + 32];
+        char target[PATH_MAX];
+        snprintf(link, sizeof(link), "/proc/self/fd/%s", de->d_name);
+        ssize_t n = readlink(link, target, sizeof(target) - 1);
+        target[n < 0 ? 0 : n] = '\0';
+        fprintf(out, "  %s -> %s\n", de->d_name, target);
+    }
+    closedir(d);
+}
+
+// saved stdio for restoring after a redirection
+int old_stdout = -1;
+int old_stdin = -1;
+int old_stderr = -1;
+
+// split line on spaces into a calloc'd token list of *ntoks slots
+char **tokenize(char *line, size_t *cnt, size_t *ntoks) {
+    MEM_TAG(MEM_PARSE);
+    *cnt = 0;
+    *ntoks = MIN_TOKEN_LIST_SIZE;
+    char delim[2] = " ";
+    char **tokens = calloc(*ntoks, sizeof(char*));
+    char *token = strtok(line, delim);
+    while (token != NULL) {
+        // strip newline char
+        char *ptr = NULL;
+        if ((ptr = strchr(token, '\n'))) *ptr = '\0';
+
+        if (*cnt >= *ntoks) {
+            *ntoks *= 2;
+            tokens = reallocarray(tokens, *ntoks, sizeof(char*));
+            memset(tokens + *cnt, 0, (*ntoks - *cnt) * sizeof(char*));
+        }
+        tokens[*cnt] = malloc(strlen(token) + 1);
+        strcpy(tokens[*cnt], token);
+        (*cnt)++;
+        token = strtok(NULL, delim);
+    }
+    return tokens;
+}
+
+// run one line of input; returns 1 if it asks the shell to exit
+int run_line(char *line) {
+    // ignore blank lines
+    int allspace = 1;
+    if (strcmp("\n", line) == 0) return 0;
+    for (size_t i = 0; i < strlen(line); i++) if (!isspace(line[i])) { allspace = 0; break; }
+    if (allspace == 1) return 0;
+
+    // ignore comments
+    char com[2] = "#";
+    if (strncmp(line, com, strlen(com)) == 0) return 0;
+
+    size_t cnt, ntoks;
+    char **tokens = tokenize(line, &cnt, &ntoks);
+
+
+    // 1. log in history (excluding builtins)
+    if (!is_builtin(tokens[0])) log_in_history(cnt, tokens);
+
+    // 2. handle redirections
+    int redir_rc = 1;
+    for (size_t r = 0; r < TOTAL_REDIRECTIONS; r++) {
+        char *redir = NULL;
+        char *dup_arg = strdup(tokens[cnt - 1]);
+        if ((redir = strstr(dup_arg, redirects[r])) != NULL) {
+            // check if it precedes with a fd num
+            char *ptr = tokens[cnt - 1];
+            int fd = -1;
+            while (isdigit(*ptr) != 0) {
+                if (fd == -1) fd = 0;
+                fd = fd * 10 + (*ptr - '0');
+                ptr++;
+            }
+
+            *redir = '\0';
+            redir += strlen(redirects[r]);
+            if (redir != NULL) {
+                fflush(stdout);
+                fflush(stderr);
+                old_stdout = dup(STDOUT_FILENO);
+                old_stdin = dup(STDIN_FILENO);
+                old_stderr = dup(STDERR_FILENO);
+                if ((redir_rc = (*redirect_fn[r])(redir, fd)) == -1)
+                    shell_rc = redir_rc;
+                free(dup_arg);
+                break;
+            }
+        }
+        free(dup_arg);
+    }
+
+    int exiting = 0;
+    if (redir_rc >= 0) {
+        if (redir_rc == 0) cnt--;
+
+        // exit gracefully if user inputs "exit"
+        if (strcmp(tokens[0], EXIT) == 0) {
+            if (cnt != 1) shell_rc = -1;
+            else exiting = 1;
+        }
+        else {
+            // 3. parse vars
+            char **parsed_tokens;
+            if ((parsed_tokens = parse_cmd(cnt, tokens)) == NULL) {
+                shell_rc = -1;
+            }
+
+            // 4. execute
+            else {
+                shell_rc = exec_cmd(cnt, parsed_tokens);
+                free(parsed_tokens);
+            }
+        }
+    }
+
+    // restore stdio for the next line
+    if (old_stdout != -1) {
+        fflush(stdout);
+        fflush(stderr);
+        dup2(old_stdout, STDOUT_FILENO);
+        dup2(old_stdin, STDIN_FILENO);
+        dup2(old_stderr, STDERR_FILENO);
+        close(old_stdout);
+        close(old_stdin);
+        close(old_stderr);
+        old_stdout = old_stdin = old_stderr = -1;
+    }
+    freev((void*)tokens, ntoks, 1);
+    return exiting;
+}
+
+void free_shell() {
+    free_locals();
+    free_history(hhead);
+    free_loadables();
+#ifdef WSH_MEMSTATS
+    // anything still live here has leaked
+    mem_report(stderr);
+#endif
+}
+
+// --------WATCH MODE---------
+//
+// wsh --watch <script> runs the script once, then re-runs only the lines
+// whose inputs changed, plus the lines downstream of their outputs.
+
+// a script line with the files it reads and writes
+typedef struct wline {
+    char *text;
+    char *cwd;
+    char **reads;
+    size_t nreads;
+    char **writes;
+    size_t nwrites;
+    int dirty;
+} wline;
+
+// a watched directory
+typedef struct wdir {
+    int wd;
+    char *path;
+} wdir;
+
+// list of unique paths
+typedef struct pathset {
+    char **paths;
+    size_t n;
+    size_t cap;
+} pathset;
+
+int pathset_has(pathset *set, const char *path) {
+    for (size_t i = 0; i < set->n; i++)
+        if (strcmp(set->paths[i], path) == 0) return 1;
+    return 0;
+}
+
+void pathset_add(pathset *set, const char *path) {
+    if (pathset_has(set, path)) return;
+    if (set->n >= set->cap) {
+        set->cap = set->cap == 0 ? MIN_TOKEN_LIST_SIZE : set->cap * 2;
+        set->paths = reallocarray(set->paths, set->cap, sizeof(char*));
+    }
+    set->paths[set->n++] = strdup(path);
+}
+
+void pathset_clear(pathset *set) {
+    for (size_t i = 0; i < set->n; i++) free(set->paths[i]);
+    set->n = 0;
+}
+
+// absolute path of fname with its directory resolved, NULL if the
+// directory doesn't exist
+char *watch_path(const char *fname) {
+    char *dup = strdup(fname);
+    char *slash = strrchr(dup, '/');
+    char *base = slash ? slash + 1 : dup;
+    char dir[PATH_MAX];
+    if (slash) *slash = '\0';
+    if (realpath(slash ? (*dup ? dup : "/") : ".", dir) == NULL || *base == '\0') {
+        free(dup);
+        return NULL;
+    }
+
+    size_t pathlen = strlen(dir) + strlen("/") + strlen(base) + 1;
+    char *path = malloc(pathlen);
+    snprintf(path, pathlen, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, base);
+    free(dup);
+    return path;
+}
+
+void wline_add(char ***list, size_t *n, const char *fname) {
+    char *path = watch_path(fname);
+    if (path == NULL) return;
+    *list = reallocarray(*list, *n + 1, sizeof(char*));
+    (*list)[(*n)++] = path;
+}
+
+// record which files a line reads (< targets, file arguments) and
+// writes (>, >>, &>, &>> targets), relative to the current directory
+void watch_analyze(wline *wl) {
+    char *line = strdup(wl->text);
+    size_t cnt = 0;
+    size_t ntoks = MIN_TOKEN_LIST_SIZE;
+    char delim[3] = " \n";
+    char **tokens = calloc(ntoks, sizeof(char*));
+    char *token = strtok(line, delim);
+    while (token != NULL) {
+        if (cnt >= ntoks) {
+            ntoks *= 2;
+            tokens = reallocarray(tokens, ntoks, sizeof(char*));
+        }
+        tokens[cnt++] = token;
+        token = strtok(NULL, delim);
+    }
+    if (cnt == 0 || tokens[0][0] == '#') {
+        free(tokens);
+        free(line);
+        return;
+    }
+
+    // redirection target (same matching order as run_line)
+    for (size_t r = 0; r < TOTAL_REDIRECTIONS; r++) {
+        char *redir = strstr(tokens[cnt - 1], redirects[r]);
+        if (redir == NULL) continue;
+        redir += strlen(redirects[r]);
+        if (strcmp(redirects[r], R_IN) == 0) wline_add(&wl->reads, &wl->nreads, redir);
+        else wline_add(&wl->writes, &wl->nwrites, redir);
+        cnt--;
+        break;
+    }
+
+    // arguments (and a path-given command) naming existing files
+    char **parsed = parse_cmd(cnt, tokens);
+    for (size_t i = 0; parsed != NULL && i < cnt; i++) {
+        struct stat st;
+        if (i == 0 && strchr(parsed[i], '/') == NULL) continue;
+        if (stat(parsed[i], &st) == 0 && S_ISREG(st.st_mode))
+            wline_add(&wl->reads, &wl->nreads, parsed[i]);
+    }
+    free(parsed);
+    free(tokens);
+    free(line);
+}
+
+// 1 if wl reads or writes path
+int wline_names(wline *wl, const char *path) {
+    for (size_t r = 0; r < wl->nreads; r++) if (strcmp(wl->reads[r], path) == 0) return 1;
+    for (size_t w = 0; w < wl->nwrites; w++) if (strcmp(wl->writes[w], path) == 0) return 1;
+    return 0;
+}
+
+void free_wlines(wline *lines, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        free(lines[i].text);
+        free(lines[i].cwd);
+        freev((void*)lines[i].reads, lines[i].nreads, 1);
+        freev((void*)lines[i].writes, lines[i].nwrites, 1);
+    }
+    free(lines);
+}
+
+// run a line from the directory it first ran in
+int watch_run_line(wline *wl) {
+    if (wl->cwd != NULL && chdir(wl->cwd) != 0) return 0;
+    char *line = strdup(wl->text);
+    int exiting = run_line(line);
+    free(line);
+    return exiting;
+}
+
+// load the script and run it once, recording each line's files
+wline *watch_load(const char *script, size_t *nlines) {
+    FILE *stream = fopen(script, "r");
+    if (stream == NULL) return NULL;
+
+    size_t cap = MIN_TOKEN_LIST_SIZE;
+    wline *lines = calloc(cap, sizeof(wline));
+    char *line = NULL;
+    size_t len = 0;
+    int exiting = 0;
+    *nlines = 0;
+    while (getline(&line, &len, stream) != -1) {
+        if (*nlines >= cap) {
+            cap *= 2;
+            lines = reallocarray(lines, cap, sizeof(wline));
+        }
+        wline *wl = &lines[(*nlines)++];
+        memset(wl, 0, sizeof(wline));
+        wl->text = strdup(line);
+        if (exiting) continue;
+
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) != NULL) wl->cwd = strdup(cwd);
+        watch_analyze(wl);
+        exiting = watch_run_line(wl);
+    }
+    libc_free(line);
+    fclose(stream);
+    return lines;
+}
+
+// watch the directory holding path (to catch replace-by-rename as well)
+void watch_dir_of(int ifd, wdir **dirs, size_t *ndirs, const char *path) {
+    char *dir = strdup(path);
+    char *slash = strrchr(dir, '/');
+    if (slash == dir) slash[1] = '\0';
+    else *slash = '\0';
+
+    for (size_t i = 0; i < *ndirs; i++) {
+        if (strcmp((*dirs)[i].path, dir) == 0) { free(dir); return; }
+    }
+    int wd = inotify_add_watch(ifd, dir, WATCH_EVENTS);
+    if (wd == -1) { free(dir); return; }
+    *dirs = reallocarray(*dirs, *ndirs + 1, sizeof(wdir));
+    (*dirs)[*ndirs].wd = wd;
+    (*dirs)[(*ndirs)++].path = dir;
+}
+
+// read queued inotify events into changed
+void watch_read_events(int ifd, wdir *dirs, size_t ndirs, pathset *changed) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(ifd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+            if (ev->len == 0) continue;
+            for (size_t i = 0; i < ndirs; i++) {
+                if (dirs[i].wd != ev->wd) continue;
+                size_t pathlen = strlen(dirs[i].path) + strlen("/") + strlen(ev->name) + 1;
+                char *path = malloc(pathlen);
+                snprintf(path, pathlen, "%s/%s", strcmp(dirs[i].path, "/") == 0 ? "" : dirs[i].path, ev->name);
+                pathset_add(changed, path);
+                free(path);
+                break;
+            }
+        }
+    }
+}
+
+int watch_script(const char *script) {
+    char *script_path = watch_path(script);
+    if (script_path == NULL || access(script_path, R_OK) != 0) {
+        free(script_path);
+        return -1;
+    }
+
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd == -1) { free(script_path); return -1; }
+
+    size_t nlines = 0;
+    wline *lines = NULL;
+    wdir *dirs = NULL;
+    size_t ndirs = 0;
+    pathset changed = { 0 };
+    pathset touched = { 0 };
+    pathset pending = { 0 };
+    int reload = 1;
+    for (;;) {
+        // (re)load the script on start and whenever it is edited
+        if (reload) {
+            free_wlines(lines, nlines);
+            if ((lines = watch_load(script_path, &nlines)) == NULL) nlines = 0;
+            watch_dir_of(ifd, &dirs, &ndirs, script_path);
+            for (size_t i = 0; i < nlines; i++) {
+                for (size_t r = 0; r < lines[i].nreads; r++) watch_dir_of(ifd, &dirs, &ndirs, lines[i].reads[r]);
+                for (size_t w = 0; w < lines[i].nwrites; w++) watch_dir_of(ifd, &dirs, &ndirs, lines[i].writes[w]);
+            }
+            reload = 0;
+
+            // drop events caused by the run itself
+            watch_read_events(ifd, dirs, ndirs, &changed);
+            pathset_clear(&changed);
+        }
+
+        // wait for a change, then until WATCH_DEBOUNCE_MS pass quietly
+        struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+        if (changed.n == 0 && poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        do watch_read_events(ifd, dirs, ndirs, &changed);
+        while (poll(&pfd, 1, WATCH_DEBOUNCE_MS) > 0);
+
+        if (pathset_has(&changed, script_path)) {
+            pathset_clear(&changed);
+            reload = 1;
+            continue;
+        }
+
+        // re-run lines reading a changed file in script order. Events
+        // on files a line names feed only the lines after it (so a line
+        // editing its own input doesn't loop); events on files an
+        // earlier re-run line named are its own; the rest wait for the
+        // next round.
+        pathset_clear(&touched);
+        pathset_clear(&pending);
+        for (size_t i = 0; i < nlines; i++) {
+            wline *wl = &lines[i];
+            wl->dirty = 0;
+            for (size_t r = 0; r < wl->nreads && !wl->dirty; r++)
+                if (pathset_has(&changed, wl->reads[r])) wl->dirty = 1;
+            if (!wl->dirty) continue;
+
+            int exiting = watch_run_line(wl);
+            pathset ready = { 0 };
+            watch_read_events(ifd, dirs, ndirs, &ready);
+            for (size_t e = 0; e < ready.n; e++) {
+                if (wline_names(wl, ready.paths[e])) pathset_add(&changed, ready.paths[e]);
+                else if (!pathset_has(&touched, ready.paths[e])) pathset_add(&pending, ready.paths[e]);
+            }
+            freev((void*)ready.paths, ready.n, 1);
+            for (size_t r = 0; r < wl->nreads; r++) pathset_add(&touched, wl->reads[r]);
+            for (size_t w = 0; w < wl->nwrites; w++) {
+                pathset_add(&touched, wl->writes[w]);
+                pathset_add(&changed, wl->writes[w]);
+            }
+            if (exiting) break;
+        }
+        pathset_clear(&changed);
+        for (size_t i = 0; i < pending.n; i++) pathset_add(&changed, pending.paths[i]);
+    }
+
+    for (size_t i = 0; i < ndirs; i++) free(dirs[i].path);
+    free(dirs);
+    freev((void*)changed.paths, changed.n, 1);
+    freev((void*)touched.paths, touched.n, 1);
+    freev((void*)pending.paths, pending.n, 1);
+    free_wlines(lines, nlines);
+    free(script_path);
+    close(ifd);
+    return shell_rc;
+}
+
 int main(int argc, char *argv[]) {
     // intialize default PATH
     if (setenv(PATH, DEFAULT_PATH, 1) != 0) {
@@ -348,10 +1199,6 @@ int main(int argc, char *argv[]) {
         return shell_rc;
     }
 
-    // intialize file descriptor values
-    int old_stdout = 0;
-    int old_stdin = 0;
-    int old_stderr = 0;
     FILE *instream = NULL;
 
     if (argc == 1) instream = stdin;
@@ -363,6 +1210,11 @@ int main(int argc, char *argv[]) {
             return shell_rc;
         }
     }
+    else if (argc == 3 && strcmp(argv[1], WATCH_FLAG) == 0) {
+        shell_rc = watch_script(argv[2]);
+        free_shell();
+        return shell_rc;
+    }
     else {
         shell_rc = -1;
         return shell_rc;
@@ -370,121 +1222,12 @@ int main(int argc, char *argv[]) {
 
     char *line = NULL;
     size_t len = 0;
-    ssize_t read;
-    size_t ntoks = MIN_TOKEN_LIST_SIZE;
-    size_t cnt = 0;
-    char delim[2] = " ";
-    int allspace = 1;
-    while (prompt(instream) && (read = getline(&line, &len, instream)) != -1) {
-        // ignore blank lines
-        allspace = 1;
-        if (strcmp("\n", line) == 0) continue;
-        for (size_t i = 0; i < strlen(line); i++) if (!isspace(line[i])) { allspace = 0; break; }
-        if (allspace == 1) continue;
-
-        // ignore comments
-        char com[2] = "#";
-        if (strncmp(line, com, strlen(com)) == 0) continue;
-
-        cnt = 0;
-        ntoks = MIN_TOKEN_LIST_SIZE;
-        char **tokens = calloc(ntoks, sizeof(char*));
-        char *token = strtok(line, delim);
-        while (token != NULL) {
-            // strip newline char
-            char *ptr = NULL;
-            if ((ptr = strchr(token, '\n'))) *ptr = '\0';
-
-            if (cnt >= ntoks) {
-                ntoks *= 2;
-                tokens = reallocarray(tokens, ntoks, sizeof(char*));
-            }
-            tokens[cnt] = malloc(strlen(token) + 1);
-            strcpy(tokens[cnt], token);
-            cnt++;
-            token = strtok(NULL, delim);
-        }
-
-
-        // 1. log in history (excluding builtins)
-        int isbuiltin = 0;
-        for (size_t i = 0; i < TOTAL_BUILTINS; i++)
-            if (strcmp(tokens[0], builtins[i]) == 0) { isbuiltin = 1; break; }
-        if (!isbuiltin) log_in_history(cnt, tokens);
-
-        // 2. handle redirections
-        int redir_rc = 1;
-        for (size_t r = 0; r < TOTAL_REDIRECTIONS; r++) {
-            char *redir = NULL;
-            char *dup_arg = strdup(tokens[cnt - 1]);
-            if ((redir = strstr(dup_arg, redirects[r])) != NULL) {
-                // check if it precedes with a fd num
-                char *ptr = tokens[cnt - 1];
-                int fd = -1;
-                while (isdigit(*ptr) != 0) {
-                    if (fd == -1) fd = 0;
-                    fd = fd * 10 + (*ptr - '0');
-                    ptr++;
-                }
-
-                *redir = '\0';
-                redir += strlen(redirects[r]);
-                if (redir != NULL) {
-                    old_stdout = dup(STDOUT_FILENO);
-                    old_stdin = dup(STDIN_FILENO);
-                    old_stderr = dup(STDERR_FILENO);
-                    if ((redir_rc = (*redirect_fn[r])(redir, fd)) == -1)
-                        shell_rc = redir_rc;
-                    free(dup_arg);
-                    break;
-                }
-            }
-            free(dup_arg);
-        }
-
-        if (redir_rc >= 0) {
-            if (redir_rc == 0) cnt--;
-
-            // exit gracefully if user inputs "exit"
-            if (strcmp(tokens[0], EXIT) == 0) {
-                if (cnt != 1) { shell_rc = -1; continue; }
-                else {
-                    close(old_stdout);
-                    close(old_stdin);
-                    close(old_stderr);
-                    fclose(instream);
-                    freev((void*)tokens, ntoks, 1);
-                    free(line);
-                    free_locals();
-                    free_history(hhead);
-                    exit(shell_rc);
-                }
-            }
-
-            // 3. parse vars
-            char **parsed_tokens;
-            if ((parsed_tokens = parse_cmd(cnt, tokens)) == NULL) {
-                shell_rc = -1;
-            }
-
-            // 3. execute
-            else {
-                shell_rc = exec_cmd(cnt, parsed_tokens);
-                dup2(STDOUT_FILENO, old_stdout);
-                dup2(STDIN_FILENO, old_stdin);
-                dup2(STDERR_FILENO, old_stderr);
-                freev((void*)parsed_tokens, cnt, 1);
-            }
-        }
-        freev((void*)tokens, ntoks, 1);
+    while (prompt(instream) && getline(&line, &len, instream) != -1) {
+        if (run_line(line)) break;
     }
-    close(old_stdout);
-    close(old_stdin);
-    close(old_stderr);
     fclose(instream);
-    free(line);
-    free_locals();
-    free_history(hhead);
+    libc_free(line);
+    free_shell();
     return shell_rc;
 }
 
@@ -572,8 +1315,7 @@ int r_input(char *fname, int fd) {
 // Usage: cd <dir-path>
 int wsh_cd(size_t argc, char** args) {
     if (argc != 2) return -1;
-    char *var_v = fetch_if_var(args[1]);
-    if (chdir(var_v == NULL ? args[1] : var_v) != 0) return -1;
+    if (chdir(args[1]) != 0) return -1;
     return 0;
 }
 
@@ -582,74 +1324,55 @@ int wsh_cd(size_t argc, char** args) {
 int wsh_export(size_t argc, char** args) {
     if (argc != 2) return -1;
 
-    size_t cnt = 0;
-    const size_t nvars = 2;
-    char delim[2] = "=";
-    char *dup_arg = strdup(args[1]);
-    char *token = strtok(dup_arg, delim);
-    char **tokens = calloc(nvars, sizeof(char*));
-    while (token != NULL) {
-        tokens[cnt] = malloc(strlen(token) + 1);
-        strcpy(tokens[cnt++], token);
-        token = strtok(NULL, delim);
-    }
-
-    // should have atleast 2 tokens for key-val pair
-    if (cnt < nvars) {
-        free(dup_arg);
-        freev((void*)tokens, nvars, 1);
-        return -1;
-    }
+    // should have both a key and a value
+    char *eq = strchr(args[1], '=');
+    if (eq == NULL || eq == args[1] || eq[1] == '\0') return -1;
 
     int rc = 0;
-    if ((rc = setenv(tokens[0], tokens[1], 1)) != 0) rc = -1;
-    free(dup_arg);
-    freev((void*)tokens, nvars, 1);
+    *eq = '\0';
+    if ((rc = setenv(args[1], eq + 1, 1)) != 0) rc = -1;
+    *eq = '=';
     return rc;
 }
 
 // Usage: local <name>=<val>
 //        local <name>=$VAR
 int wsh_local(size_t argc, char** args) {
+    MEM_TAG(MEM_LOCALS);
     if (argc != 2 || args == NULL) return -1;
 
-    size_t cnt = 0;
-    const size_t nvars = 2;
-    char delim[2] = "=";
-    char *dup_arg = strdup(args[1]);
-    char *token = strtok(dup_arg, delim);
-    char **tokens = calloc(nvars, sizeof(char*));
-    while (token != NULL) {
-        tokens[cnt] = malloc(strlen(token) + 1);
-        strcpy(tokens[cnt++], token);
-        token = strtok(NULL, delim);
+    // set val as empty if not provided
+    char *eq = strchr(args[1], '=');
+    size_t namelen = eq == NULL ? strlen(args[1]) : (size_t)(eq - args[1]);
+    if (namelen == 0) return -1;
+
+    // update existing variables in place
+    const char *value = eq == NULL ? "" : eq + 1;
+    localvar *i = lhead;
+    localvar *tail = NULL;
+    while (i != NULL) {
+        if (strncmp(i->name, args[1], namelen) == 0 && i->name[namelen] == '\0') {
+            free(i->value);
+            i->value = strdup(value);
+            return 0;
+        }
+        tail = i;
+        i = i->next;
     }
 
     localvar *newvar = malloc(sizeof(localvar));
-    // set val as empty if not provided
-    if (cnt < nvars) {
-        newvar->value = malloc(strlen("") + 1);
-        strcpy(newvar->value, "");
-    }
-    else {
-        newvar->value = malloc(strlen(tokens[1]) + 1);
-        strcpy(newvar->value, tokens[1]);
-    }
-    newvar->name = malloc(strlen(tokens[0]) + 1);
-    strcpy(newvar->name, tokens[0]);
+    newvar->name = strndup(args[1], namelen);
+    newvar->value = strdup(value);
+    newvar->next = NULL;
 
-    if (lhead == NULL) {
+    if (tail == NULL) {
         newvar->idx = 0;
         lhead = newvar;
     }
     else {
-        lhead->next = newvar;
-        newvar->idx = lhead->idx+1;
+        tail->next = newvar;
+        newvar->idx = tail->idx + 1;
     }
-    newvar->next = NULL;
-
-    free(dup_arg);
-    freev((void*)tokens, nvars, 1);
     return 0;
 }
 
@@ -669,6 +1392,7 @@ int wsh_vars(size_t argc, char** args) {
 //        history <n>
 //        history set <n>
 int wsh_history(size_t argc, char** args) {
+    MEM_TAG(MEM_HISTORY);
     if (argc > 3) return -1;
 
     // print history
@@ -699,7 +1423,7 @@ int wsh_history(size_t argc, char** args) {
                     char **parsed_tokens;
                     if ((parsed_tokens = parse_cmd(curr->argc, curr->argv)) == NULL) return -1;
                     int rc = exec_cmd(curr->argc, parsed_tokens);
-                    freev((void*)parsed_tokens, curr->argc, 1);
+                    free(parsed_tokens);
                     return rc;
                 }
                 curr = curr->next;
@@ -758,9 +1482,771 @@ int wsh_ls(size_t argc, char** args) {
     while (i < n) {
         if (strncmp(pre, names[i]->d_name, strlen(pre)) != 0)
             printf("%s\n", names[i]->d_name);
-        free(names[i]);
+        libc_free(names[i]);
         i++;
     }
-    free(names);
+    libc_free(names);
+    return 0;
+}
+
+
+// parallel job state
+typedef struct pjob {
+    size_t first;
+    size_t nargs;
+    pid_t pid;
+    int pidfd;
+    int done;
+    int timed;      // deadline is armed
+    int killed;     // signalled for running past $WSH_TIMEOUT
+    struct timespec deadline;
+    FILE *out;
+    FILE *err;
+} pjob;
+
+// count "{}" placeholders in a template token
+size_t count_braces(char *tok) {
+    size_t n = 0;
+    char *ptr = tok;
+    while ((ptr = strstr(ptr, "{}")) != NULL) { n++; ptr += 2; }
+    return n;
+}
+
+// copy tok with every "{}" replaced by arg
+char *subst_braces(char *tok, char *arg) {
+    size_t n = count_braces(tok);
+    size_t arglen = strlen(arg);
+    char *res = malloc(strlen(tok) - 2 * n + arglen * n + 1);
+    char *dst = res;
+    char *ptr = NULL;
+    while ((ptr = strstr(tok, "{}")) != NULL) {
+        memcpy(dst, tok, ptr - tok);
+        dst += ptr - tok;
+        memcpy(dst, arg, arglen);
+        dst += arglen;
+        tok = ptr + 2;
+    }
+    strcpy(dst, tok);
+    return res;
+}
+
+// bytes an input adds to a job's argv (strings + pointers)
+size_t job_arg_cost(char **tmpl, size_t ntmpl, int has_braces, char *arg) {
+    size_t arglen = strlen(arg);
+    if (!has_braces) return arglen + 1 + sizeof(char*);
+
+    size_t cost = 0;
+    for (size_t i = 0; i < ntmpl; i++) {
+        size_t n = count_braces(tmpl[i]);
+        if (n > 0) cost += strlen(tmpl[i]) - 2 * n + arglen * n + 1 + sizeof(char*);
+    }
+    return cost;
+}
+
+// build argv for a job: tokens with "{}" are repeated once per input,
+// otherwise the inputs are appended at the end (xargs-style)
+char **build_job_argv(char **tmpl, size_t ntmpl, int has_braces, char **in, size_t nin, size_t *jargc) {
+    size_t cnt = 0;
+    size_t total = has_braces ? 0 : ntmpl + nin;
+    if (has_braces)
+        for (size_t i = 0; i < ntmpl; i++) total += count_braces(tmpl[i]) > 0 ? nin : 1;
+
+    char **argv = calloc(total + 1, sizeof(char*));
+    for (size_t i = 0; i < ntmpl; i++) {
+        if (has_braces && count_braces(tmpl[i]) > 0) {
+            for (size_t j = 0; j < nin; j++) argv[cnt++] = subst_braces(tmpl[i], in[j]);
+        }
+        else { argv[cnt++] = strdup(tmpl[i]); }
+    }
+    if (!has_braces)
+        for (size_t j = 0; j < nin; j++) argv[cnt++] = strdup(in[j]);
+    argv[cnt] = NULL;
+    *jargc = cnt;
+    return argv;
+}
+
+// read newline separated inputs, skipping blank lines
+void read_job_inputs(FILE *stream, char ***inputs, size_t *ninputs, size_t *cap) {
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    while ((read = getline(&line, &len, stream)) != -1) {
+        if (read > 0 && line[read - 1] == '\n') line[--read] = '\0';
+        if (read == 0) continue;
+        if (*ninputs >= *cap) {
+            *cap *= 2;
+            *inputs = reallocarray(*inputs, *cap, sizeof(char*));
+        }
+        (*inputs)[(*ninputs)++] = strdup(line);
+    }
+    libc_free(line);
+}
+
+// copy a captured job stream to fd and release it
+void flush_job_stream(FILE *stream, int fd) {
+    if (stream == NULL) return;
+    char buf[BUFSIZ];
+    ssize_t n;
+    rewind(stream);
+    while ((n = read(fileno(stream), buf, sizeof(buf))) > 0) write_all(fd, buf, n);
+    fclose(stream);
+}
+
+void flush_job(pjob *job) {
+    fflush(stdout);
+    fflush(stderr);
+    flush_job_stream(job->out, STDOUT_FILENO);
+    flush_job_stream(job->err, STDERR_FILENO);
+    job->out = NULL;
+    job->err = NULL;
+}
+
+// Usage: parallel [-j <n>] [-g|-k] [-X] <cmd> [args...] ::: <arg>...
+//        parallel [-j <n>] [-g|-k] [-X] <cmd> [args...] :::: <file>
+//        parallel [-j <n>] [-g|-k] [-X] <cmd> [args...]
+// Runs cmd once per input (from the list, the file or stdin) with "{}"
+// replaced by it, keeping at most n children in flight.
+//   -g  group each job's output and print it when the job finishes
+//   -k  like -g, but print in input order
+//   -X  pack as many inputs per job as fit in ARG_MAX
+// Each job is killed once it runs past $WSH_TIMEOUT, and counts as failed.
+// Returns the number of failed jobs (capped at 101).
+int wsh_parallel(size_t argc, char** args) {
+    if (argc < 2 || args == NULL) return -1;
+
+    long nslots = sysconf(_SC_NPROCESSORS_ONLN);
+    int group = 0, keep = 0, xargs = 0;
+    size_t i = 1;
+    for (; i < argc && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-j") == 0 && i + 1 < argc) {
+            errno = 0;
+            char *endptr;
+            nslots = strtol(args[++i], &endptr, 10);
+            if (errno == ERANGE || *endptr != '\0' || nslots <= 0) return -1;
+        }
+        else if (strcmp(args[i], "-g") == 0) group = 1;
+        else if (strcmp(args[i], "-k") == 0) group = keep = 1;
+        else if (strcmp(args[i], "-X") == 0) xargs = 1;
+        else return -1;
+    }
+    if (nslots <= 0) nslots = 1;
+
+    // split command template from its inputs
+    char **tmpl = &args[i];
+    size_t ntmpl = 0;
+    while (i + ntmpl < argc && strcmp(tmpl[ntmpl], ":::") != 0 && strcmp(tmpl[ntmpl], "::::") != 0)
+        ntmpl++;
+    if (ntmpl == 0) return -1;
+
+    // only external commands can be fanned out
+    if (is_builtin(tmpl[0])) return -1;
+
+    size_t cap = MIN_TOKEN_LIST_SIZE;
+    size_t ninputs = 0;
+    char **inputs = calloc(cap, sizeof(char*));
+    size_t sep = i + ntmpl;
+    if (sep == argc) {
+        FILE *stream = fdopen(dup(STDIN_FILENO), "r");
+        if (stream == NULL) { free(inputs); return -1; }
+        read_job_inputs(stream, &inputs, &ninputs, &cap);
+        fclose(stream);
+    }
+    else if (strcmp(args[sep], "::::") == 0) {
+        FILE *stream = (sep + 2 == argc) ? fopen(args[sep + 1], "r") : NULL;
+        if (stream == NULL) { free(inputs); return -1; }
+        read_job_inputs(stream, &inputs, &ninputs, &cap);
+        fclose(stream);
+    }
+    else {
+        for (size_t a = sep + 1; a < argc; a++) {
+            if (ninputs >= cap) {
+                cap *= 2;
+                inputs = reallocarray(inputs, cap, sizeof(char*));
+            }
+            inputs[ninputs++] = strdup(args[a]);
+        }
+    }
+    if (ninputs == 0) { free(inputs); return 0; }
+
+    char *cmd = resolve_cmd(tmpl[0]);
+    if (cmd == NULL) {
+        freev((void*)inputs, ninputs, 1);
+        return -1;
+    }
+
+    int has_braces = 0;
+    for (size_t t = 0; t < ntmpl; t++) if (count_braces(tmpl[t]) > 0) has_braces = 1;
+
+    // split inputs into jobs, batching up to ARG_MAX with -X
+    size_t limit = 0;
+    if (xargs) {
+        long argmax = sysconf(_SC_ARG_MAX);
+        size_t used = 2048;
+        for (char **env = environ; *env != NULL; env++) used += strlen(*env) + 1 + sizeof(char*);
+        for (size_t t = 0; t < ntmpl; t++)
+            if (!has_braces || count_braces(tmpl[t]) == 0) used += strlen(tmpl[t]) + 1 + sizeof(char*);
+        limit = (argmax > 0 && (size_t)argmax > used) ? (size_t)argmax - used : 0;
+    }
+    size_t njobs = 0;
+    pjob *jobs = calloc(ninputs, sizeof(pjob));
+    for (size_t a = 0; a < ninputs; njobs++) {
+        size_t bytes = job_arg_cost(tmpl, ntmpl, has_braces, inputs[a]);
+        jobs[njobs].first = a++;
+        jobs[njobs].nargs = 1;
+        while (xargs && a < ninputs) {
+            size_t cost = job_arg_cost(tmpl, ntmpl, has_braces, inputs[a]);
+            if (bytes + cost > limit) break;
+            bytes += cost;
+            jobs[njobs].nargs++;
+            a++;
+        }
+    }
+
+    // keep up to nslots jobs running; a slot holds the index of its job
+    if ((size_t)nslots > njobs) nslots = (long)njobs;
+    size_t *slots = malloc(nslots * sizeof(size_t));
+    struct pollfd *pfds = malloc(nslots * sizeof(struct pollfd));
+    if (slots == NULL || pfds == NULL) {
+        free(slots);
+        free(pfds);
+        free(jobs);
+        free(cmd);
+        freev((void*)inputs, ninputs, 1);
+        return -1;
+    }
+    size_t running = 0, next = 0, flushed = 0, failed = 0;
+    double timeout = default_timeout();
+    while (next < njobs || running > 0) {
+        while (running < (size_t)nslots && next < njobs) {
+            pjob *job = &jobs[next];
+            if (group) {
+                job->out = tmpfile();
+                job->err = tmpfile();
+                if (job->out) fcntl(fileno(job->out), F_SETFD, FD_CLOEXEC);
+                if (job->err) fcntl(fileno(job->err), F_SETFD, FD_CLOEXEC);
+            }
+            size_t jargc = 0;
+            char **jargv = build_job_argv(tmpl, ntmpl, has_braces, &inputs[job->first], job->nargs, &jargc);
+            fflush(stdout);
+            fflush(stderr);
+            job->pid = launch_proc(cmd, jargv,
+                                   job->out ? fileno(job->out) : -1,
+                                   job->err ? fileno(job->err) : -1);
+            freev((void*)jargv, jargc, 1);
+            if (job->pid == -1) { job->done = 1; failed++; }
+            else {
+                job->pidfd = proc_pidfd(job->pid);
+                job->timed = timeout > 0;
+                if (job->timed) deadline_in(&job->deadline, timeout);
+                slots[running++] = next;
+            }
+            next++;
+        }
+
+        if (running > 0) {
+            // sleep until a job exits or the nearest deadline passes;
+            // jobs without a pidfd are checked every WAIT_POLL_MS
+            int ms = -1;
+            nfds_t npfds = 0;
+            for (size_t s = 0; s < running; s++) {
+                pjob *job = &jobs[slots[s]];
+                int job_ms = -1;
+                if (job->pidfd != -1) pfds[npfds++] = (struct pollfd){ .fd = job->pidfd, .events = POLLIN };
+                else job_ms = WAIT_POLL_MS;
+                if (job->timed) {
+                    int left = ms_until(&job->deadline);
+                    if (job_ms == -1 || left < job_ms) job_ms = left;
+                }
+                if (job_ms != -1 && (ms == -1 || job_ms < ms)) ms = job_ms;
+            }
+            if (poll(pfds, npfds, ms) == -1 && errno != EINTR) break;
+
+            for (size_t s = 0; s < running;) {
+                pjob *job = &jobs[slots[s]];
+                int status;
+                pid_t wpid = waitpid(job->pid, &status, WNOHANG);
+                if (wpid == -1 && errno == EINTR) continue;
+                if (wpid == 0) {
+                    // past the deadline: SIGTERM, then SIGKILL after the grace period
+                    if (job->timed && ms_until(&job->deadline) == 0) {
+                        signal_proc(job->pid, job->pidfd, job->killed ? SIGKILL : SIGTERM);
+                        if (job->killed) job->timed = 0;
+                        else deadline_in(&job->deadline, DEFAULT_KILL_GRACE);
+                        job->killed = 1;
+                    }
+                    s++;
+                    continue;
+                }
+                if (job->pidfd != -1) close(job->pidfd);
+                job->done = 1;
+                if (wpid == -1 || job->killed || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+                if (group && !keep) flush_job(job);
+                slots[s] = slots[--running];
+            }
+        }
+
+        while (keep && flushed < next && jobs[flushed].done) flush_job(&jobs[flushed++]);
+    }
+    for (size_t j = 0; j < njobs; j++) flush_job(&jobs[j]);
+
+    free(slots);
+    free(pfds);
+    free(jobs);
+    free(cmd);
+    freev((void*)inputs, ninputs, 1);
+    return failed > 101 ? 101 : (int)failed;
+}
+
+
+// Usage: enable
+//        enable -f <lib.so> <name>
+//        enable -d <name>
+int wsh_enable(size_t argc, char** args) {
+    // list loaded builtins
+    if (argc == 1) {
+        loadable *i = bhead;
+        while (i != NULL) {
+            printf("enable -f %s %s\n", i->path, i->name);
+            i = i->next;
+        }
+        return 0;
+    }
+
+    // unload a builtin
+    if (argc == 3 && strcmp(args[1], "-d") == 0) {
+        loadable **i = &bhead;
+        while (*i != NULL) {
+            if (strcmp(args[2], (*i)->name) == 0) {
+                loadable *tmp = *i;
+                *i = tmp->next;
+                free_loadable(tmp);
+                return 0;
+            }
+            i = &(*i)->next;
+        }
+        return -1;
+    }
+
+    if (argc != 4 || strcmp(args[1], "-f") != 0) return -1;
+    char *name = args[3];
+
+    // static builtins can't be shadowed, reloading replaces the old one
+    if (strcmp(name, EXIT) == 0) return -1;
+    for (size_t i = 0; i < TOTAL_BUILTINS; i++)
+        if (strcmp(name, builtins[i]) == 0) return -1;
+
+    void *handle = dlopen(args[2], RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) return -1;
+
+    size_t symlen = strlen(name) + strlen(WSH_BUILTIN_SUFFIX) + 1;
+    char *sym = malloc(symlen);
+    snprintf(sym, symlen, "%s%s", name, WSH_BUILTIN_SUFFIX);
+    wsh_builtin *def = dlsym(handle, sym);
+    free(sym);
+    if (def == NULL || def->abi != WSH_BUILTIN_ABI || def->fn == NULL) {
+        dlclose(handle);
+        return -1;
+    }
+
+    loadable *b = find_loadable(name);
+    if (b != NULL) {
+        dlclose(b->handle);
+        free(b->path);
+    }
+    else {
+        b = malloc(sizeof(loadable));
+        b->name = strdup(name);
+        b->next = bhead;
+        bhead = b;
+    }
+    b->path = strdup(args[2]);
+    b->handle = handle;
+    b->fn = def->fn;
+    return 0;
+}
+
+
+// growable byte buffer
+typedef struct cbuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} cbuf;
+
+void cbuf_append(cbuf *b, const void *data, size_t n) {
+    if (b->len + n > b->cap) {
+        b->cap = b->cap == 0 ? BUFSIZ : b->cap;
+        while (b->len + n > b->cap) b->cap *= 2;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+// append a null-separated field to a cache key
+void key_field(cbuf *key, const char *field) {
+    cbuf_append(key, field, strlen(field) + 1);
+}
+
+// append a file's identity (device/inode/size/mtime) to a cache key
+void key_file(cbuf *key, const char *tag, struct stat *st) {
+    char id[128];
+    snprintf(id, sizeof(id), "%s:%lu:%lu:%lld:%lld.%09ld", tag,
+             (unsigned long)st->st_dev, (unsigned long)st->st_ino,
+             (long long)st->st_size, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+    key_field(key, id);
+}
+
+// 64-bit FNV-1a
+uint64_t fnv1a(const char *buf, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)buf[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// cache hits/misses for this session
+size_t cache_hits = 0;
+size_t cache_misses = 0;
+
+size_t cache_limit() {
+    char *val = getenv(CACHE_SIZE_ENV);
+    if (val == NULL) return DEFAULT_CACHE_SIZE;
+    errno = 0;
+    char *endptr;
+    long long lim = strtoll(val, &endptr, 10);
+    if (errno == ERANGE || *endptr != '\0' || lim <= 0) return DEFAULT_CACHE_SIZE;
+    return (size_t)lim;
+}
+
+// cache store directory, created if missing
+char *cache_dir() {
+    char *dir = getenv(CACHE_DIR_ENV);
+    if (dir != NULL) dir = strdup(dir);
+    else {
+        char *home = getenv("HOME");
+        if (home == NULL) return NULL;
+        size_t dirlen = strlen(home) + strlen("/") + strlen(DEFAULT_CACHE_DIR) + 1;
+        dir = malloc(dirlen);
+        snprintf(dir, dirlen, "%s/%s", home, DEFAULT_CACHE_DIR);
+    }
+    if (mkdir(dir, S_IRWXU) != 0 && errno != EEXIST) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+// cache entries, oldest first
+typedef struct centry {
+    char *path;
+    off_t size;
+    struct timespec mtime;
+} centry;
+
+int centry_cmp(const void *a, const void *b) {
+    const centry *x = a, *y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    if (x->mtime.tv_nsec != y->mtime.tv_nsec) return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// list cache entries; returns the count and their total size in *total
+size_t cache_entries(char *dir, centry **entries, size_t *total) {
+    size_t n = 0, cap = MIN_TOKEN_LIST_SIZE;
+    *entries = calloc(cap, sizeof(centry));
+    *total = 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL) return 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        // entries are named by their 16 hex digit key hash
+        if (strlen(de->d_name) != 16) continue;
+
+        size_t pathlen = strlen(dir) + strlen("/") + strlen(de->d_name) + 1;
+        char *path = malloc(pathlen);
+        snprintf(path, pathlen, "%s/%s", dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) { free(path); continue; }
+
+        if (n >= cap) {
+            cap *= 2;
+            *entries = reallocarray(*entries, cap, sizeof(centry));
+        }
+        (*entries)[n].path = path;
+        (*entries)[n].size = st.st_size;
+        (*entries)[n].mtime = st.st_mtim;
+        *total += st.st_size;
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+void free_centries(centry *entries, size_t n) {
+    for (size_t i = 0; i < n; i++) free(entries[i].path);
+    free(entries);
+}
+
+// drop least recently used entries until the store fits in limit
+void cache_evict(char *dir, size_t limit) {
+    centry *entries;
+    size_t total;
+    size_t n = cache_entries(dir, &entries, &total);
+    qsort(entries, n, sizeof(centry), centry_cmp);
+    for (size_t i = 0; i < n && total > limit; i++) {
+        if (unlink(entries[i].path) == 0) total -= entries[i].size;
+    }
+    free_centries(entries, n);
+}
+
+// replay a stored entry; returns its exit code, or -1 on a miss
+int cache_replay(char *path, cbuf *key) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+
+    int rc = -1, code;
+    size_t keylen, outlen, errlen;
+    if (fscanf(f, CACHE_MAGIC " %d %zu %zu %zu", &code, &keylen, &outlen, &errlen) == 4
+        && fgetc(f) == '\n' && keylen == key->len) {
+        size_t len = keylen + outlen + errlen;
+        char *data = malloc(len > 0 ? len : 1);
+        if (fread(data, 1, len, f) == len && memcmp(data, key->data, keylen) == 0) {
+            fflush(stdout);
+            fflush(stderr);
+            write_all(STDOUT_FILENO, data + keylen, outlen);
+            write_all(STDERR_FILENO, data + keylen + outlen, errlen);
+            rc = code;
+        }
+        free(data);
+    }
+    fclose(f);
+
+    // refresh mtime so eviction is least-recently-used
+    if (rc != -1) utimensat(AT_FDCWD, path, NULL, 0);
+    return rc;
+}
+
+// write an entry atomically (tmp file + rename)
+void cache_store(char *dir, char *path, cbuf *key, int code, cbuf *out, cbuf *err) {
+    size_t tmplen = strlen(path) + strlen(".XXXXXX") + 1;
+    char *tmp = malloc(tmplen);
+    snprintf(tmp, tmplen, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd == -1) { free(tmp); return; }
+
+    FILE *f = fdopen(fd, "w");
+    fprintf(f, CACHE_MAGIC " %d %zu %zu %zu\n", code, key->len, out->len, err->len);
+    if (key->len) fwrite(key->data, 1, key->len, f);
+    if (out->len) fwrite(out->data, 1, out->len, f);
+    if (err->len) fwrite(err->data, 1, err->len, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+    free(tmp);
+
+    cache_evict(dir, cache_limit());
+}
+
+// run cmd, teeing its stdout/stderr to ours and into out/err
+// capture stops (and *fits is cleared) once limit bytes are exceeded
+// or cmd is killed for running past $WSH_TIMEOUT
+// returns the exit code, 124 if it was killed, or -1 if it couldn't run
+int cache_tee(char *cmd, char **args, cbuf *out, cbuf *err, size_t limit, int *fits) {
+    int outp[2], errp[2];
+    if (pipe2(outp, O_CLOEXEC) != 0) return -1;
+    if (pipe2(errp, O_CLOEXEC) != 0) {
+        close(outp[0]);
+        close(outp[1]);
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child_pid = launch_proc(cmd, args, outp[1], errp[1]);
+    close(outp[1]);
+    close(errp[1]);
+
+    struct pollfd pfd[2] = {
+        { .fd = outp[0], .events = POLLIN },
+        { .fd = errp[0], .events = POLLIN },
+    };
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    cbuf *bufs[2] = { out, err };
+    int nopen = 2;
+    char buf[BUFSIZ];
+    double timeout = default_timeout();
+    struct timespec deadline;
+    if (timeout > 0) deadline_in(&deadline, timeout);
+    while (child_pid != -1 && nopen > 0) {
+        int rc = poll(pfd, 2, timeout > 0 ? ms_until(&deadline) : -1);
+        if (rc == 0) break;
+        if (rc == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (pfd[i].fd == -1 || pfd[i].revents == 0) continue;
+            ssize_t n = read(pfd[i].fd, buf, sizeof(buf));
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) {
+                close(pfd[i].fd);
+                pfd[i].fd = -1;
+                nopen--;
+                continue;
+            }
+            write_all(fds[i], buf, n);
+            if (*fits && out->len + err->len + n <= limit) cbuf_append(bufs[i], buf, n);
+            else *fits = 0;
+        }
+    }
+    for (int i = 0; i < 2; i++) if (pfd[i].fd != -1) close(pfd[i].fd);
+    if (child_pid == -1) return -1;
+
+    int killed;
+    int code = wait_proc_until(child_pid, timeout > 0 ? &deadline : NULL, DEFAULT_KILL_GRACE, &killed);
+    if (killed) *fits = 0;
+    return code;
+}
+
+// Usage: cache <cmd> [args...]
+//        cache stats
+//        cache clear
+// Replays the stdout/stderr/exit code of an earlier identical run of cmd,
+// or runs it and stores its output. Runs are identical when argv, cwd, the
+// executable, the env vars named in $WSH_CACHE_ENV (colon separated) and
+// the file on stdin (by inode/size/mtime) all match; with a pipe or tty on
+// stdin cmd just runs uncached. The store lives in
+// $WSH_CACHE_DIR (default ~/.wsh_cache) and is capped at $WSH_CACHE_SIZE
+// bytes, evicting least recently used entries.
+int wsh_cache(size_t argc, char** args) {
+    if (argc < 2 || args == NULL) return -1;
+
+    char *dir = cache_dir();
+    if (dir == NULL) return -1;
+
+    if (argc == 2 && (strcmp(args[1], "stats") == 0 || strcmp(args[1], "clear") == 0)) {
+        centry *entries;
+        size_t total;
+        size_t n = cache_entries(dir, &entries, &total);
+        if (strcmp(args[1], "stats") == 0) {
+            printf("entries: %zu\n", n);
+            printf("bytes: %zu\n", total);
+            printf("limit: %zu\n", cache_limit());
+            printf("hits: %zu\n", cache_hits);
+            printf("misses: %zu\n", cache_misses);
+        }
+        else {
+            for (size_t i = 0; i < n; i++) unlink(entries[i].path);
+        }
+        free_centries(entries, n);
+        free(dir);
+        return 0;
+    }
+
+    // only external commands have cacheable output
+    char *cmd = is_builtin(args[1]) ? NULL : resolve_cmd(args[1]);
+    struct stat st;
+    if (cmd == NULL || stat(cmd, &st) != 0) {
+        free(cmd);
+        free(dir);
+        return -1;
+    }
+
+    // output read from a pipe or tty can't be keyed, so only a regular
+    // file (keyed by identity below) or /dev/null on stdin is cacheable
+    struct stat in_st, null_st;
+    int in_ok = fstat(STDIN_FILENO, &in_st) == 0;
+    if (!in_ok || (!S_ISREG(in_st.st_mode) &&
+                   !(S_ISCHR(in_st.st_mode) && stat("/dev/null", &null_st) == 0 &&
+                     in_st.st_rdev == null_st.st_rdev))) {
+        int code = exec_in_new_proc(cmd, &args[1]);
+        free(cmd);
+        free(dir);
+        return code;
+    }
+
+    // 1. build the key
+    cbuf key = { 0 };
+    char cwd[PATH_MAX];
+    key_field(&key, getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    key_field(&key, cmd);
+    key_file(&key, "exe", &st);
+    for (size_t i = 1; i < argc; i++) key_field(&key, args[i]);
+    char *names = getenv(CACHE_ENV_ENV);
+    if (names != NULL) {
+        char *names_dup = strdup(names);
+        char delim[2] = ":";
+        char *token = strtok(names_dup, delim);
+        while (token != NULL) {
+            char *val = getenv(token);
+            key_field(&key, token);
+            key_field(&key, val ? val : "");
+            token = strtok(NULL, delim);
+        }
+        free(names_dup);
+    }
+    if (S_ISREG(in_st.st_mode)) key_file(&key, "stdin", &in_st);
+
+    size_t pathlen = strlen(dir) + 18;
+    char *path = malloc(pathlen);
+    snprintf(path, pathlen, "%s/%016llx", dir, (unsigned long long)fnv1a(key.data, key.len));
+
+    // 2. replay on a hit, otherwise run and store
+    int code = cache_replay(path, &key);
+    if (code != -1) cache_hits++;
+    else {
+        cache_misses++;
+        cbuf out = { 0 }, err = { 0 };
+        size_t limit = cache_limit();
+        int fits = 1;
+        code = cache_tee(cmd, &args[1], &out, &err, limit, &fits);
+        if (code != -1 && fits) cache_store(dir, path, &key, code, &out, &err);
+        free(out.data);
+        free(err.data);
+    }
+
+    free(key.data);
+    free(path);
+    free(cmd);
+    free(dir);
+    return code;
+}
+
+
+// Usage: timeout [-k <secs>] <secs> <cmd> [args...]
+// Sends SIGTERM to cmd if it runs longer than secs, then SIGKILL if it is
+// still running after the -k grace period (default 2s). Returns cmd's
+// exit status, or 124 if it had to be killed.
+int wsh_timeout(size_t argc, char** args) {
+    size_t i = 1;
+    double grace = DEFAULT_KILL_GRACE;
+    if (argc > 2 && strcmp(args[1], "-k") == 0) {
+        if ((grace = parse_secs(args[2])) < 0) return -1;
+        i = 3;
+    }
+    if (argc < i + 2) return -1;
+
+    double secs = parse_secs(args[i]);
+    if (secs < 0) return -1;
+
+    // builtins run in-process and can't be killed
+    char *cmd = is_builtin(args[i + 1]) ? NULL : resolve_cmd(args[i + 1]);
+    if (cmd == NULL) return -1;
+
+    int killed;
+    int rc = -1;
+    pid_t child_pid = launch_proc(cmd, &args[i + 1], -1, -1);
+    if (child_pid != -1) rc = wait_proc(child_pid, secs, grace, &killed);
+    free(cmd);
+    return rc;
+}
+
+
+// Usage: memstats
+int wsh_memstats(size_t argc, char** args) {
+    if (argc != 1 || args == NULL) return -1;
+    mem_report(stdout);
     return 0;
 }
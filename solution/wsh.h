@@ -6,6 +6,11 @@
 #define VARS    "vars"
 #define HISTORY "history"
 #define LS      "ls"
+#define PARALLEL "parallel"
+#define ENABLE  "enable"
+#define CACHE   "cache"
+#define TIMEOUT "timeout"
+#define MEMSTATS "memstats"
 
 int wsh_cd(size_t argc, char** args);
 int wsh_export(size_t argc, char** args);
@@ -13,6 +18,11 @@ int wsh_local(size_t argc, char** args);
 int wsh_vars(size_t argc, char** args);
 int wsh_history(size_t argc, char** args);
 int wsh_ls(size_t argc, char** args);
+int wsh_parallel(size_t argc, char** args);
+int wsh_enable(size_t argc, char** args);
+int wsh_cache(size_t argc, char** args);
+int wsh_timeout(size_t argc, char** args);
+int wsh_memstats(size_t argc, char** args);
 
 
 // redirection tokens
@@ -0,0 +1,34 @@
+// Stable ABI for builtins loaded at runtime with `enable -f <lib.so> <name>`.
+//
+// A loadable builtin is a shared object exporting a descriptor named
+// <name>_builtin:
+//
+//     wsh_builtin hello_builtin = { WSH_BUILTIN_ABI, "hello", hello_main };
+//
+// The shell calls fn in-process with stdio already redirected for the
+// line. fn should write to out_fd/err_fd and return what the tool would
+// exit with (0 on success); the shell uses it unchanged as the command's
+// status, so a builtin behaves like the binary it replaces.
+
+#ifndef WSH_BUILTIN_H
+#define WSH_BUILTIN_H
+
+#define WSH_BUILTIN_ABI 1
+#define WSH_BUILTIN_SUFFIX "_builtin"
+
+typedef struct wsh_builtin_ctx {
+    int argc;
+    char **argv;
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    char **envp;
+} wsh_builtin_ctx;
+
+typedef struct wsh_builtin {
+    int abi;
+    const char *name;
+    int (*fn)(const wsh_builtin_ctx *ctx);
+} wsh_builtin;
+
+#endif